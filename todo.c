@@ -5,6 +5,15 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <regex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define NAME "TODO"
 #define VERSION "0.0.9v"
@@ -14,14 +23,34 @@
 
 #define FLAG_DESCRIPTION_LEN 128
 
+#define MIN_READ_CHUNK_SIZE 4096
+#define MAX_MERGE_RUNS 64
+
+#define CONVERT_BUFFER_SIZE (1024 * 1024)
+
+#define PIPELINE_CHUNK_SIZE (64 * 1024)
+#define PIPELINE_RING_SIZE 16
+#define PIPELINE_SPIN_COUNT 64
+
+#define MANIFEST_FILE_NAME "MANIFEST"
+#define MAX_SHARDS_COUNT 1024
+
 typedef enum FLAG_TYPES {
     SHOW_HELP,
     SHOW_VERSION,
     SET_PRIORITY_FILTER, UNSET_PRIORITY_FILTER,
     SET_TITLE_NAME_FILTER, UNSET_TITLE_NAME_FILTER,
     SET_PRIORITY_LEVEL,
+    SET_SORT_MEMORY_BUDGET,
+    SET_WHERE_FILTER,
+    SET_PIPELINE_MODE,
     ADD_TODO,
     REMOVE_TODO,
+    EDIT_TODO,
+    MERGE_TODOS,
+    SHARD_TODOS,
+    IMPORT_TODOS,
+    EXPORT_TODOS,
 } flag_action_t;
 
 typedef struct {
@@ -39,8 +68,16 @@ static const flag_t FLAGS[] = {
     {SET_TITLE_NAME_FILTER,   FLAG_IDENTIFIER "t=1", FLAG_IDENTIFIER FLAG_IDENTIFIER "title=1",    "Sets title name filter to true."},
     {UNSET_TITLE_NAME_FILTER, FLAG_IDENTIFIER "t=0", FLAG_IDENTIFIER FLAG_IDENTIFIER "title=0",    "Sets title name filter to false."},
     {SET_PRIORITY_LEVEL,      FLAG_IDENTIFIER "l",   FLAG_IDENTIFIER FLAG_IDENTIFIER "level",      "Sets level filter. Usage: -l <number>"},
+    {SET_SORT_MEMORY_BUDGET,  FLAG_IDENTIFIER "b",   FLAG_IDENTIFIER FLAG_IDENTIFIER "budget",     "Sorts files larger than budget in temporary files. Usage: -b <bytes>"},
+    {SET_WHERE_FILTER,        FLAG_IDENTIFIER "w",   FLAG_IDENTIFIER FLAG_IDENTIFIER "where",      "Sets expression filter. Usage: -w 'priority<=2 && (title^=Fix || description~\"a|b\")'"},
+    {SET_PIPELINE_MODE,       FLAG_IDENTIFIER "P",   FLAG_IDENTIFIER FLAG_IDENTIFIER "pipeline",   "Reads, parses and prints unsorted todos in parallel threads. Requires -p=0 and no -t=1."},
     {ADD_TODO,                FLAG_IDENTIFIER "a",   FLAG_IDENTIFIER FLAG_IDENTIFIER "add",        "Adds new todo to the " TODO_FILE_NAME " file. Usage: -a <priority> <todo_title>"},
-    {REMOVE_TODO,             FLAG_IDENTIFIER "r",   FLAG_IDENTIFIER FLAG_IDENTIFIER "remove",     "Removes todo from the " TODO_FILE_NAME " file. Usage: -r <title_name>"}
+    {REMOVE_TODO,             FLAG_IDENTIFIER "r",   FLAG_IDENTIFIER FLAG_IDENTIFIER "remove",     "Removes todo from the " TODO_FILE_NAME " file. Usage: -r <title_name>"},
+    {EDIT_TODO,               FLAG_IDENTIFIER "e",   FLAG_IDENTIFIER FLAG_IDENTIFIER "edit",       "Edits todo. Usage: -e <title_name> [--priority <number>] [--title <new_title_name>]"},
+    {MERGE_TODOS,             FLAG_IDENTIFIER "m",   FLAG_IDENTIFIER FLAG_IDENTIFIER "merge",      "Three-way merges todo files into <ours>. Usage: -m <base> <ours> <theirs>"},
+    {SHARD_TODOS,             FLAG_IDENTIFIER "s",   FLAG_IDENTIFIER FLAG_IDENTIFIER "shard",      "Splits todos into shard files of new directory. Usage: -s <count> <directory>"},
+    {IMPORT_TODOS,            FLAG_IDENTIFIER "i",   FLAG_IDENTIFIER FLAG_IDENTIFIER "import",     "Converts stdin to todos on stdout. Usage: -i <ndjson|csv>"},
+    {EXPORT_TODOS,            FLAG_IDENTIFIER "x",   FLAG_IDENTIFIER FLAG_IDENTIFIER "export",     "Converts todos to stdout. Usage: -x <ndjson|csv>"}
 };
 
 enum FILTERS {
@@ -53,24 +90,33 @@ typedef struct {
     char* todo_file_name;
     uint8_t filters;
     long priority_level;
+    size_t sort_memory_budget;
+    bool is_pipelined;
 } config_t;
 
 static config_t CONFIG = {
     .todo_file_name = TODO_FILE_NAME,
     .filters = PRIORITY_F,
-    .priority_level = 0
+    .priority_level = 0,
+    .sort_memory_budget = 0,
+    .is_pipelined = false
 };
 
 typedef struct {
     char* title;
     char* description;
+    const char* raw_description;
+    size_t raw_description_len;
+    size_t offset;
+    size_t header_len;
+    size_t len;
     long priority;
 } todo_t;
 
-static char* strip(const char *str) {
+static char* strip(const char *str, size_t len) {
     if(!str) return NULL;
 
-    size_t begin = 0, end = strlen(str);
+    size_t begin = 0, end = len;
 
     while (begin < end && isspace(str[begin])) begin++;
     while (end > begin && isspace(str[end - 1])) end--;
@@ -86,7 +132,7 @@ static char* strip(const char *str) {
         return NULL;
     }
 
-    strncpy(trimmed_str, str + begin, new_length);
+    memcpy(trimmed_str, str + begin, new_length);
     trimmed_str[new_length] = 0;
 
     return trimmed_str;
@@ -156,6 +202,25 @@ static char* read_file(const char *file_name) {
     return buffer;
 }
 
+static long get_file_size(const char* file_name) {
+    struct stat file_stat;
+
+    if(stat(file_name, &file_stat)) return -1;
+
+    return file_stat.st_size;
+}
+
+static uint64_t hash_string(const char* str) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    while(*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
 static bool starts_with(const char* str, const char* prefix) {
     size_t prefix_len = strlen(prefix);
 
@@ -195,28 +260,52 @@ static int is_num(const char* str) {
     return buf-str;
 }
 
-static void print_until_symbol(const char *str, char symbol) {
+static void print_until_symbol(FILE* stream, const char *str, char symbol) {
     const char *pos = strchr(str, symbol);
 
     if (pos) {
-        printf("%.*s", (int)(pos-str), str);
+        fprintf(stream, "%.*s", (int)(pos-str), str);
 
         return;
     }
 
-    printf("%s", str);
+    fprintf(stream, "%s", str);
 }
 
-static inline void show_error(const char* str, const char* processed_str, int line_number) {
+static inline void show_error(FILE* stream, const char* str, const char* processed_str, int line_number, int first_line_number) {
     int offset = find_nth_occurrence(str, '\n', line_number - 1);
 
-    printf("%d | ", line_number); 
-    print_until_symbol(str + offset + 1, '\n'); 
-    printf("\n"); 
+    fprintf(stream, "%d | ", first_line_number + line_number - 1); 
+    print_until_symbol(stream, str + offset + 1, '\n'); 
+    fprintf(stream, "\n"); 
+
+    offset = processed_str - str - offset + get_number_length(first_line_number + line_number - 1) + 2; 
+    while(offset-->0) fprintf(stream, " "); 
+    fprintf(stream, "^\n");
+}
+
+/* Formats the error the way it is printed, so that a caller which must not
+ * exit (a pipeline thread) can pass it on. */
+static char* parse_error(const char* str, const char* processed_str, int line_number, int first_line_number, const char* format, ...) {
+    char* error = NULL;
+    size_t error_len = 0;
 
-    offset = processed_str - str - offset + get_number_length(line_number) + 2; 
-    while(offset-->0) printf(" "); 
-    printf("^\n");
+    FILE* stream = open_memstream(&error, &error_len);
+    if(!stream) {
+        printf("Error: allocating memory.\n");
+        exit(1);
+    }
+
+    show_error(stream, str, processed_str, line_number, first_line_number);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stream, format, args);
+    va_end(args);
+
+    fclose(stream);
+
+    return error;
 }
 
 static inline void new_todo(todo_t** todos, int* todo_index) {
@@ -249,7 +338,36 @@ static void clear_todos(todo_t* todos) {
     free(todos);
 }
 
-static todo_t* parse_todos(const char* str) {
+static inline void skip_to_description_end(const char** str, int* line_number) {
+    const char* end = strstr(*str, "}}");
+    if(!end) end = *str + strlen(*str);
+
+    for(const char* nl = *str; (nl = memchr(nl, '\n', end - nl)); ++nl) {
+        *line_number += 1;
+    }
+
+    *str = end;
+}
+
+/* Frees the todos parsed before an error, including the title of the todo at
+ * todo_index that was being parsed. */
+static todo_t* clear_partial_todos(todo_t* todos, int todo_index) {
+    free(todos[todo_index].title);
+    memset(&todos[todo_index], 0, sizeof(todo_t));
+
+    clear_todos(todos);
+
+    return NULL;
+}
+
+/* Descriptions are not copied while parsing. With keep_descriptions the byte
+ * span inside str is recorded and todo_description() trims and copies it on
+ * first access, so str must outlive the todos. Errors are reported with line
+ * numbers counted from first_line_number: NULL is returned and error is set
+ * to the message. */
+static todo_t* try_parse_todos(const char* str, bool keep_descriptions, int first_line_number, char** error) {
+    *error = NULL;
+
     if(!str) return NULL;
 
     int todo_index = 0;
@@ -266,15 +384,15 @@ static todo_t* parse_todos(const char* str) {
         if(starts_with(buf, "TODO") && *buf) {
             new_todo(&todos, &todo_index);
 
+            todos[todo_index].offset = buf - str;
+
             buf += strlen("TODO"); 
 
             skip_space(&buf, &line_number);
 
             if(*buf != ':') {
-                show_error(str, buf, line_number);
-
-                printf("Error: expected ':'.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: expected ':'.\n");
+                return clear_partial_todos(todos, todo_index);
             }
 
             ++buf;
@@ -283,10 +401,8 @@ static todo_t* parse_todos(const char* str) {
 
             token_len = is_num(buf);
             if(!token_len) {
-                show_error(str, buf, line_number);
-
-                printf("Error: priority is invalid or does not provided.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: priority is invalid or does not provided.\n");
+                return clear_partial_todos(todos, todo_index);
             }            
 
             char* pr_str = malloc(sizeof(char) * (token_len + 1));
@@ -299,24 +415,24 @@ static todo_t* parse_todos(const char* str) {
             long priority = strtol(pr_str, &endptr, 10);
 
             if (errno) {
-                show_error(str, buf, line_number);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: converting priority to number.\n");
+                free(pr_str);
 
-                printf("Error: converting priority to number.\n");
-                exit(1);
+                return clear_partial_todos(todos, todo_index);
             }
 
             if (*endptr) {
-                show_error(str, buf, line_number);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: trailing characters after priority: %s.\n", endptr);
+                free(pr_str);
 
-                printf("Error: trailing characters after priority: %s.\n", endptr);
-                exit(1);
+                return clear_partial_todos(todos, todo_index);
             }
 
             if(priority <= 0) {
-                show_error(str, buf, line_number);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: priority is less or equal to 0.\n");
+                free(pr_str);
 
-                printf("Error: priority is less or equal to 0.\n");
-                exit(1);
+                return clear_partial_todos(todos, todo_index);
             }
 
             todos[todo_index].priority = priority;
@@ -328,10 +444,8 @@ static todo_t* parse_todos(const char* str) {
             skip_space(&buf, &line_number);
 
             if(*buf != '"') {
-                show_error(str, buf, line_number);
-
-                printf("Error: expected starting '\"'.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: expected starting '\"'.\n");
+                return clear_partial_todos(todos, todo_index);
             }
 
             ++buf;
@@ -345,17 +459,13 @@ static todo_t* parse_todos(const char* str) {
             }
 
             if(!title_len) {
-                show_error(str, buf, line_number);
-
-                printf("Error: title is empty.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: title is empty.\n");
+                return clear_partial_todos(todos, todo_index);
             }
 
             if(*buf != '"') {
-                show_error(str, buf, line_number);
-
-                printf("Error: expected ending '\"'.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: expected ending '\"'.\n");
+                return clear_partial_todos(todos, todo_index);
             }
 
             ++buf; 
@@ -367,41 +477,31 @@ static todo_t* parse_todos(const char* str) {
             skip_space(&buf, &line_number);
 
             if(!starts_with(buf, "{{")) {
-                show_error(str, buf, line_number);
-
-                printf("Error: expected '{{'.\n");
-                exit(1);
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: expected '{{'.\n");
+                return clear_partial_todos(todos, todo_index);
             }
+
+            todos[todo_index].header_len = buf - str - todos[todo_index].offset;
             
             buf += strlen("{{");
 
-            size_t description_len = 0;
-            while(*buf && !starts_with(buf, "}}")) {
-                if(*buf == '\n') ++line_number;
-                ++description_len; 
-                ++buf;
-            }
+            const char* description = buf;
 
-            if(!starts_with(buf, "}}")) {
-                show_error(str, buf, line_number);
+            skip_to_description_end(&buf, &line_number);
 
-                printf("Error: expected ending '}}'.\n");
-                exit(1);
+            if(!starts_with(buf, "}}")) {
+                *error = parse_error(str, buf, line_number, first_line_number, "Error: expected ending '}}'.\n");
+                return clear_partial_todos(todos, todo_index);
             }
             
-            buf += strlen("}}");
-
-            if(description_len) {
-                todos[todo_index].description = malloc(sizeof(char)*(description_len+1));
-                memcpy(todos[todo_index].description, buf-description_len-2, description_len);
-                todos[todo_index].description[description_len] = 0;
-
-                char* trimmed_description = strip(todos[todo_index].description);
+            if(keep_descriptions && buf != description) {
+                todos[todo_index].raw_description = description;
+                todos[todo_index].raw_description_len = buf - description;
+            }
 
-                free(todos[todo_index].description);
+            buf += strlen("}}");
 
-                todos[todo_index].description = trimmed_description;
-            }
+            todos[todo_index].len = buf - str - todos[todo_index].offset;
 
             ++todo_index;
 
@@ -410,10 +510,10 @@ static todo_t* parse_todos(const char* str) {
             continue;
         } 
 
-        show_error(str, buf, line_number);
+        new_todo(&todos, &todo_index);
 
-        printf("Error: expected '%s' statement.\n", "TODO");
-        exit(1);
+        *error = parse_error(str, buf, line_number, first_line_number, "Error: expected '%s' statement.\n", "TODO");
+        return clear_partial_todos(todos, todo_index);
     }
 
     new_todo(&todos, &todo_index);
@@ -421,6 +521,28 @@ static todo_t* parse_todos(const char* str) {
     return todos;
 }
 
+static todo_t* parse_todos(const char* str, bool keep_descriptions, int first_line_number) {
+    char* error = NULL;
+
+    todo_t* todos = try_parse_todos(str, keep_descriptions, first_line_number, &error);
+
+    if(error) {
+        printf("%s", error);
+        exit(1);
+    }
+
+    return todos;
+}
+
+static const char* todo_description(todo_t* todo) {
+    if(!todo->description && todo->raw_description) {
+        todo->description = strip(todo->raw_description, todo->raw_description_len);
+        todo->raw_description = NULL;
+    }
+
+    return todo->description;
+}
+
 static void sort_todos_by_title_name(todo_t* todos) {
     int i, j, n = 0;
 
@@ -452,75 +574,175 @@ static void sort_todos_by_priority(todo_t* todos) {
     }
 }
 
-static todo_t* get_todos() {
-    char* file_content = read_file(CONFIG.todo_file_name);
-    if(!file_content) return NULL;
+/* Only titles and priorities are available unless file_content is given, in
+ * which case the caller owns the file buffer and frees it after the todos. */
+static todo_t* get_todos(const char* file_name, char** file_content) {
+    char* content = read_file(file_name);
+    if(!content) return NULL;
 
-    todo_t* todos = parse_todos(file_content);
+    todo_t* todos = parse_todos(content, file_content != NULL, 1);
+
+    if(file_content) *file_content = content;
+    else free(content);
 
-    free(file_content);
     return todos;
 }
 
-static void print_todos(todo_t* todos) {
-    if(!todos) return;
+/* A store is either a single todo file or a directory with a manifest and
+ * todos partitioned by title hash into shard files, so that adding, removing
+ * or editing a todo touches only one shard. */
+typedef struct {
+    char** file_names;
+    int files_count;
+    bool is_sharded;
+} store_t;
 
-    bool todo_is_found = false;
+static store_t STORE = {0};
 
-    printf("TODOs:\n");
+static char* get_shard_file_name(const char* directory, int shard) {
+    int len = snprintf(NULL, 0, "%s/shard-%04d", directory, shard);
+    char* file_name = malloc(sizeof(char) * (len + 1));
 
-    if(!todos) {
-        printf("No TODOs.\n");
-        return;
+    snprintf(file_name, len + 1, "%s/shard-%04d", directory, shard);
+
+    return file_name;
+}
+
+static char* get_manifest_file_name(const char* directory) {
+    int len = snprintf(NULL, 0, "%s/%s", directory, MANIFEST_FILE_NAME);
+    char* file_name = malloc(sizeof(char) * (len + 1));
+
+    snprintf(file_name, len + 1, "%s/%s", directory, MANIFEST_FILE_NAME);
+
+    return file_name;
+}
+
+static store_t* get_store() {
+    if(STORE.file_names) return &STORE;
+
+    struct stat file_stat;
+
+    if(stat(CONFIG.todo_file_name, &file_stat) || !S_ISDIR(file_stat.st_mode)) {
+        STORE.file_names = malloc(sizeof(char*));
+        STORE.file_names[0] = CONFIG.todo_file_name;
+        STORE.files_count = 1;
+
+        return &STORE;
     }
 
-    if(CONFIG.filters & TITLE_NAME_F) {
-        sort_todos_by_title_name(todos);
+    char* manifest_file_name = get_manifest_file_name(CONFIG.todo_file_name);
+    FILE* manifest = fopen(manifest_file_name, "r");
+
+    int shards_count = 0;
+
+    if(!manifest || fscanf(manifest, "shards: %d", &shards_count) != 1 || 
+       shards_count <= 0 || shards_count > MAX_SHARDS_COUNT) {
+        printf("Error: '%s' is not a valid todo manifest.\n", manifest_file_name);
+        exit(1);
     }
 
-    if(CONFIG.filters & PRIORITY_F) {
-        sort_todos_by_priority(todos);
+    fclose(manifest);
+    free(manifest_file_name);
+
+    STORE.file_names = malloc(sizeof(char*) * shards_count);
+    STORE.files_count = shards_count;
+    STORE.is_sharded = true;
+
+    for(int i = 0; i < shards_count; i++) {
+        STORE.file_names[i] = get_shard_file_name(CONFIG.todo_file_name, i);
     }
 
-    for(int i = 0; todos[i].priority; i++) {
-        if(CONFIG.priority_level == 0 || todos[i].priority == CONFIG.priority_level) {
-            todo_is_found = true;
+    return &STORE;
+}
 
-            printf("-----------------------\n");
+static const char* get_todo_file_name(const char* title) {
+    store_t* store = get_store();
 
-            printf("Title: %s\nPriority: %ld\nDescription:\n  %s\n", 
-                    todos[i].title, todos[i].priority, 
-                    todos[i].description ? todos[i].description : "Not added.");
+    return store->file_names[hash_string(title) % store->files_count];
+}
 
-            printf("-----------------------\n");
-        }
-    }
+static long get_store_size(store_t* store) {
+    long size = 0;
 
-    if(!todo_is_found) {
-        printf("No TODOs.\n");
+    for(int i = 0; i < store->files_count; i++) {
+        long file_size = get_file_size(store->file_names[i]);
+        if(file_size > 0) size += file_size;
     }
+
+    return size;
 }
 
-static void show_version() {
-    printf("%s version(%s)\n", NAME, VERSION);
+typedef struct {
+    const char* file_name;
+    char* file_content;
+    todo_t* todos;
+    pthread_t thread;
+    bool is_loaded_in_thread;
+} shard_t;
+
+static void* load_shard(void* arg) {
+    shard_t* shard = arg;
+
+    shard->todos = get_todos(shard->file_name, &shard->file_content);
+
+    return NULL;
 }
 
-static void show_help() {
-    printf("%s version(%s)\n", NAME, VERSION);
+/* Shards are read and parsed in parallel and joined into one array. The file
+ * contents hold the lazy descriptions and are freed after the todos. */
+static todo_t* get_store_todos(store_t* store, char*** file_contents) {
+    shard_t* shards = calloc(store->files_count, sizeof(shard_t));
 
-    printf("Flags:\n");
-    for(size_t i = 0; i < sizeof(FLAGS) / sizeof(FLAGS[0]); i++) {
-        printf("%4s or %-12s - %-64s\n", 
-                FLAGS[i].flag_short_str, 
-                FLAGS[i].flag_long_str, 
-                FLAGS[i].description); 
+    for(int i = 0; i < store->files_count; i++) {
+        shards[i].file_name = store->file_names[i];
+        shards[i].is_loaded_in_thread = store->files_count > 1 && 
+            !pthread_create(&shards[i].thread, NULL, load_shard, &shards[i]);
+
+        if(!shards[i].is_loaded_in_thread) load_shard(&shards[i]);
+    }
+
+    int todos_count = 0;
+
+    for(int i = 0; i < store->files_count; i++) {
+        if(shards[i].is_loaded_in_thread) pthread_join(shards[i].thread, NULL);
+
+        if(!shards[i].todos) {
+            exit(1);
+        }
+
+        for(int j = 0; shards[i].todos[j].priority; j++) todos_count++;
     }
+
+    todo_t* todos = malloc(sizeof(todo_t) * (todos_count + 1));
+    *file_contents = malloc(sizeof(char*) * (store->files_count + 1));
+
+    todos_count = 0;
+
+    for(int i = 0; i < store->files_count; i++) {
+        for(int j = 0; shards[i].todos[j].priority; j++) {
+            todos[todos_count++] = shards[i].todos[j];
+        }
+
+        (*file_contents)[i] = shards[i].file_content;
+        free(shards[i].todos);
+    }
+
+    memset(&todos[todos_count], 0, sizeof(todo_t));
+    (*file_contents)[store->files_count] = NULL;
+
+    free(shards);
+
+    return todos;
 }
 
-static bool does_file_exist(const char* file_name) {
-    FILE* file = fopen(file_name, "r");
+static void free_file_contents(char** file_contents) {
+    if(!file_contents) return;
 
-    return file ? true : false;
+    for(int i = 0; file_contents[i]; i++) {
+        free(file_contents[i]);
+    }
+
+    free(file_contents);
 }
 
 static void replace_escape_sequences(char* str) {
@@ -570,138 +792,2267 @@ static void replace_escape_sequences(char* str) {
     *dst = 0; 
 }
 
-static void add_todo(todo_t* todo) {
-    if(!todo) return;
+typedef enum {
+    WHERE_PRIORITY_IN,
+    WHERE_EQUALS,
+    WHERE_PREFIX,
+    WHERE_CONTAINS,
+    WHERE_MATCHES,
+    WHERE_NOT,
+    WHERE_AND,
+    WHERE_OR,
+    WHERE_JUMP_IF_FALSE,
+    WHERE_JUMP_IF_TRUE,
+} where_op_t;
+
+typedef enum {
+    TITLE_FIELD,
+    DESCRIPTION_FIELD,
+} todo_field_t;
+
+typedef struct where_node_t {
+    where_op_t op;
+    todo_field_t field;
+    long low, high;
+    char* str;
+    regex_t* regex;
+    int cost;
+    struct where_node_t** children;
+    int children_count;
+} where_node_t;
 
-    if(does_file_exist(CONFIG.todo_file_name)) {
-        todo_t* todos = get_todos();    
+typedef struct {
+    where_op_t op;
+    todo_field_t field;
+    long low, high;
+    const char* str;
+    size_t str_len;
+    regex_t* regex;
+    int target;
+} where_instruction_t;
 
-        bool is_found = false;
+typedef struct {
+    where_instruction_t* instructions;
+    int len;
+} where_program_t;
 
-        for(int i = 0; todos[i].priority; i++) {
-            if(!strcmp(todo->title, todos[i].title)) {
-                is_found = true;
-                break;
-            }    
-        }
+static where_program_t WHERE = {0};
 
-        if(is_found) {
-            printf("Error: todo with title '%s' is already in todos.\n", todo->title);
+static void where_error(const char* pos, const char* message) {
+    printf("Error: %s in where expression at '%s'.\n", message, pos);
+    exit(1);
+}
 
-            clear_todos(todos);
-            exit(1);
-        }
+static bool accept_where_token(const char** pos, const char* token) {
+    while(isspace((unsigned char)**pos)) ++*pos;
 
-        clear_todos(todos);
-    }
+    if(!starts_with(*pos, token)) return false;
 
-    FILE* todo_file = fopen(CONFIG.todo_file_name, "a+");  
+    *pos += strlen(token);
+    return true;
+}
 
-    if(todo->description) {
-        fprintf(todo_file, "%s:%ld \"%s\" {{\n  %s\n}}\n", "TODO", todo->priority, todo->title, todo->description);
-    } else {
-        fprintf(todo_file, "%s:%ld \"%s\" {{}}\n", "TODO", todo->priority, todo->title);
+static where_node_t* new_where_node(where_op_t op, int cost) {
+    where_node_t* node = calloc(1, sizeof(where_node_t));
+    if(!node) {
+        printf("Error: allocating memory.\n");
+        exit(1);
     }
 
-    fclose(todo_file);
+    node->op = op;
+    node->cost = cost;
+
+    return node;
 }
 
-static void remove_substring(char* str, const char* sub) {
-    char* pos = strstr(str, sub); 
+static void add_where_child(where_node_t* node, where_node_t* child) {
+    bool is_flattened = child->op == node->op && (node->op == WHERE_AND || node->op == WHERE_OR);
+    int children_count = is_flattened ? child->children_count : 1;
+    int child_cost = child->cost;
 
-    if (pos != NULL) {
-        size_t len = strlen(sub);
-        memmove(pos, pos + len, strlen(pos + len) + 1); 
+    node->children = realloc(node->children, sizeof(where_node_t*) * (node->children_count + children_count));
+
+    /* a && (b && c) is flattened so all operands can be reordered together. */
+    if(is_flattened) {
+        memcpy(node->children + node->children_count, child->children, sizeof(where_node_t*) * children_count);
+
+        free(child->children);
+        free(child);
+    } else {
+        node->children[node->children_count] = child;
     }
+
+    node->children_count += children_count;
+    node->cost += child_cost;
 }
 
-int find_substring_backwards(const char* start_pos, const char* str, const char* sub) {
-    size_t sub_len = strlen(sub);
+static char* parse_where_string(const char** pos) {
+    while(isspace((unsigned char)**pos)) ++*pos;
 
-    if (start_pos < str || sub_len > (size_t)(start_pos - str + 1)) return -1;
+    const char* begin = *pos;
+    char* str = NULL;
 
-    for (const char *pos = start_pos; pos >= str; pos--) {
-        if (!strncmp(pos, sub, sub_len)) {
-            return pos - str;  
+    if(**pos == '"') {
+        ++begin;
+
+        for(++*pos; **pos && **pos != '"'; ++*pos) {
+            if(**pos == '\\' && *(*pos + 1)) ++*pos;
         }
-    }
 
-    return -1;
-}
+        if(**pos != '"') where_error(*pos, "expected ending '\"'");
 
-static int find_strict_substring(const char *str, const char *substr) {
-    int substr_len = strlen(substr);
-    int str_len = strlen(str);
-    
-    for (int i = 0; i <= str_len - substr_len; i++) {
-        if (strncmp(&str[i], substr, substr_len) == 0) {
-            if (i + substr_len == str_len || !isalnum((unsigned char)str[i + substr_len])) {
-                return i;
-            }
-        }
+        str = strndup(begin, *pos - begin);
+        ++*pos;
+
+        replace_escape_sequences(str);
+    } else {
+        while(**pos && !isspace((unsigned char)**pos) && !strchr(")&|", **pos)) ++*pos;
+
+        if(*pos == begin) where_error(*pos, "expected string");
+
+        str = strndup(begin, *pos - begin);
     }
 
-    return -1; 
+    return str;
 }
 
-static void remove_todo(const char* title_name) {
-    if(!title_name) return;
+static long parse_where_number(const char** pos) {
+    while(isspace((unsigned char)**pos)) ++*pos;
 
-    todo_t* todos = get_todos();    
-    if(!todos) {
-        exit(1);
-    }
+    char* endptr = NULL;
 
-    bool is_found = false;
-    for(int i = 0; todos[i].priority; i++) {
-        if(!strcmp(title_name, todos[i].title)) {
-            is_found = true;
-            break;
-        }    
-    }
+    errno = 0;
+    long number = strtol(*pos, &endptr, 10);
 
-    if(!is_found) {
-        printf("Error: todo with title '%s' is not found.\n", title_name);
+    if(errno || endptr == *pos) where_error(*pos, "expected number");
 
-        clear_todos(todos);
-        exit(1);
-    }
+    *pos = endptr;
+    return number;
+}
 
-    char* file_content = read_file(CONFIG.todo_file_name);
+static where_node_t* parse_where_priority(const char** pos) {
+    where_node_t* node = new_where_node(WHERE_PRIORITY_IN, 1);
 
-    int start = find_substring_backwards(file_content + find_strict_substring(file_content, title_name), file_content, "TODO"), 
-        len = 0;
+    node->low = LONG_MIN;
+    node->high = LONG_MAX;
 
-    while(!starts_with(file_content+start+len, "}}") && *(file_content+start+len)) len++;
-    len+=2;
+    const char* operator_pos = *pos;
 
-    if(*(file_content+start+len) == '\n') ++len;
+    if(accept_where_token(pos, "<=")) {
+        node->high = parse_where_number(pos);
+    } else if(accept_where_token(pos, ">=")) {
+        node->low = parse_where_number(pos);
+    } else if(accept_where_token(pos, "<")) {
+        node->high = parse_where_number(pos);
 
-    char* remove_str = malloc(sizeof(char) * (len+1));
-    strncpy(remove_str, file_content+start, len);
-    remove_str[len] = 0;
+        if(node->high == LONG_MIN) where_error(operator_pos, "priority is out of range");
+        node->high--;
+    } else if(accept_where_token(pos, ">")) {
+        node->low = parse_where_number(pos);
 
-    remove_substring(file_content, remove_str);
+        if(node->low == LONG_MAX) where_error(operator_pos, "priority is out of range");
+        node->low++;
+    } else if(accept_where_token(pos, "!=")) {
+        node->low = node->high = parse_where_number(pos);
 
-    FILE* todo_file = fopen(CONFIG.todo_file_name, "w");
-    fprintf(todo_file, "%s", file_content);
+        where_node_t* not_node = new_where_node(WHERE_NOT, 0);
+        add_where_child(not_node, node);
 
-    free(file_content);
-    clear_todos(todos);
+        return not_node;
+    } else if(accept_where_token(pos, "==") || accept_where_token(pos, "=")) {
+        node->low = node->high = parse_where_number(pos);
+
+        if(accept_where_token(pos, "..")) node->high = parse_where_number(pos);
+    } else {
+        where_error(*pos, "expected priority operator");
+    }
+
+    return node;
 }
 
-static int execute_flag(flag_action_t action, char* argv[]) {
-    char* flag = *argv;
-    int offset = 0; 
+static where_node_t* parse_where_field(const char** pos, todo_field_t field) {
+    where_node_t* node = NULL;
+    int field_cost = field == DESCRIPTION_FIELD ? 2 : 0;
+
+    if(accept_where_token(pos, "^=")) {
+        node = new_where_node(WHERE_PREFIX, 2 + field_cost);
+    } else if(accept_where_token(pos, "*=")) {
+        node = new_where_node(WHERE_CONTAINS, 3 + field_cost);
+    } else if(accept_where_token(pos, "~")) {
+        node = new_where_node(WHERE_MATCHES, 8 + field_cost);
+    } else if(accept_where_token(pos, "==") || accept_where_token(pos, "=")) {
+        node = new_where_node(WHERE_EQUALS, 2 + field_cost);
+    } else {
+        where_error(*pos, "expected one of '=', '^=', '*=', '~'");
+    }
 
-    ++argv;
+    node->field = field;
+    node->str = parse_where_string(pos);
 
-    switch(action) {
-        case SHOW_HELP:
-            show_help();
-            exit(0);
+    if(node->op == WHERE_MATCHES) {
+        node->regex = malloc(sizeof(regex_t));
 
-        case SHOW_VERSION:
+        if(!node->regex || regcomp(node->regex, node->str, REG_EXTENDED | REG_NOSUB)) {
+            where_error(node->str, "invalid regular expression");
+        }
+    }
+
+    return node;
+}
+
+static where_node_t* parse_where_or(const char** pos);
+
+static where_node_t* parse_where_unary(const char** pos) {
+    if(accept_where_token(pos, "!")) {
+        where_node_t* child = parse_where_unary(pos);
+        where_node_t* node = new_where_node(WHERE_NOT, 0);
+
+        add_where_child(node, child);
+        return node;
+    }
+
+    if(accept_where_token(pos, "(")) {
+        where_node_t* node = parse_where_or(pos);
+
+        if(!accept_where_token(pos, ")")) where_error(*pos, "expected ')'");
+
+        return node;
+    }
+
+    if(accept_where_token(pos, "priority")) return parse_where_priority(pos);
+    if(accept_where_token(pos, "title")) return parse_where_field(pos, TITLE_FIELD);
+    if(accept_where_token(pos, "description")) return parse_where_field(pos, DESCRIPTION_FIELD);
+
+    where_error(*pos, "expected 'priority', 'title' or 'description'");
+    return NULL;
+}
+
+static where_node_t* parse_where_binary(const char** pos, where_op_t op, const char* token) {
+    where_node_t* left = op == WHERE_AND ? parse_where_unary(pos) : parse_where_binary(pos, WHERE_AND, "&&");
+
+    if(!accept_where_token(pos, token)) return left;
+
+    where_node_t* node = new_where_node(op, 0);
+    add_where_child(node, left);
+
+    do {
+        add_where_child(node, op == WHERE_AND ? parse_where_unary(pos) : parse_where_binary(pos, WHERE_AND, "&&"));
+    } while(accept_where_token(pos, token));
+
+    /* Operands are commutative, so the cheapest ones run first and short
+     * circuit the string matching whenever possible. */
+    for(int i = 1; i < node->children_count; i++) {
+        where_node_t* child = node->children[i];
+        int j = i;
+
+        for(; j > 0 && node->children[j - 1]->cost > child->cost; j--) {
+            node->children[j] = node->children[j - 1];
+        }
+
+        node->children[j] = child;
+    }
+
+    return node;
+}
+
+static where_node_t* parse_where_or(const char** pos) {
+    return parse_where_binary(pos, WHERE_OR, "||");
+}
+
+static int emit_where_instruction(where_program_t* program, where_op_t op) {
+    program->instructions = realloc(program->instructions, sizeof(where_instruction_t) * (program->len + 1));
+    memset(&program->instructions[program->len], 0, sizeof(where_instruction_t));
+
+    program->instructions[program->len].op = op;
+
+    return program->len++;
+}
+
+/* Flattens the tree into a program run with a single boolean register: 'and'
+ * and 'or' become conditional jumps past the remaining operands. */
+static void compile_where_node(where_program_t* program, where_node_t* node) {
+    if(node->op == WHERE_AND || node->op == WHERE_OR) {
+        int* jumps = malloc(sizeof(int) * node->children_count);
+
+        for(int i = 0; i < node->children_count; i++) {
+            compile_where_node(program, node->children[i]);
+
+            if(i + 1 < node->children_count) {
+                jumps[i] = emit_where_instruction(program, node->op == WHERE_AND ? WHERE_JUMP_IF_FALSE : WHERE_JUMP_IF_TRUE);
+            }
+        }
+
+        for(int i = 0; i + 1 < node->children_count; i++) {
+            program->instructions[jumps[i]].target = program->len;
+        }
+
+        free(jumps);
+    } else if(node->op == WHERE_NOT) {
+        compile_where_node(program, node->children[0]);
+        emit_where_instruction(program, WHERE_NOT);
+    } else {
+        int i = emit_where_instruction(program, node->op);
+
+        program->instructions[i].field = node->field;
+        program->instructions[i].low = node->low;
+        program->instructions[i].high = node->high;
+        program->instructions[i].str = node->str;
+        program->instructions[i].str_len = node->str ? strlen(node->str) : 0;
+        program->instructions[i].regex = node->regex;
+    }
+
+    for(int i = 0; i < node->children_count; i++) {
+        free(node->children[i]);
+    }
+
+    free(node->children);
+}
+
+static void compile_where(where_program_t* program, const char* expression) {
+    const char* pos = expression;
+
+    where_node_t* root = parse_where_or(&pos);
+
+    while(isspace((unsigned char)*pos)) ++pos;
+
+    if(*pos) where_error(pos, "unexpected token");
+
+    program->len = 0;
+
+    compile_where_node(program, root);
+    free(root);
+}
+
+static bool todo_matches_where(todo_t* todo) {
+    bool result = true;
+
+    for(int pc = 0; pc < WHERE.len; pc++) {
+        const where_instruction_t* instruction = &WHERE.instructions[pc];
+        const char* value = NULL;
+
+        switch(instruction->op) {
+            case WHERE_PRIORITY_IN:
+                result = todo->priority >= instruction->low && todo->priority <= instruction->high;
+                continue;
+
+            case WHERE_NOT:
+                result = !result;
+                continue;
+
+            case WHERE_JUMP_IF_FALSE:
+                if(!result) pc = instruction->target - 1;
+                continue;
+
+            case WHERE_JUMP_IF_TRUE:
+                if(result) pc = instruction->target - 1;
+                continue;
+
+            default:
+                break;
+        }
+
+        value = instruction->field == TITLE_FIELD ? todo->title : todo_description(todo);
+        if(!value) value = "";
+
+        switch(instruction->op) {
+            case WHERE_EQUALS:
+                result = !strcmp(value, instruction->str);
+                break;
+
+            case WHERE_PREFIX:
+                result = !strncmp(value, instruction->str, instruction->str_len);
+                break;
+
+            case WHERE_CONTAINS:
+                result = strstr(value, instruction->str) != NULL;
+                break;
+
+            case WHERE_MATCHES:
+                result = !regexec(instruction->regex, value, 0, NULL, 0);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return result;
+}
+
+static bool todo_matches_filters(todo_t* todo) {
+    if(CONFIG.priority_level != 0 && todo->priority != CONFIG.priority_level) return false;
+
+    return todo_matches_where(todo);
+}
+
+static void print_todo(todo_t* todo) {
+    printf("-----------------------\n");
+
+    const char* description = todo_description(todo);
+
+    printf("Title: %s\nPriority: %ld\nDescription:\n  %s\n", 
+            todo->title, todo->priority, 
+            description ? description : "Not added.");
+
+    printf("-----------------------\n");
+}
+
+static void print_todos(todo_t* todos) {
+    if(!todos) return;
+
+    bool todo_is_found = false;
+
+    printf("TODOs:\n");
+
+    if(!todos) {
+        printf("No TODOs.\n");
+        return;
+    }
+
+    if(CONFIG.filters & TITLE_NAME_F) {
+        sort_todos_by_title_name(todos);
+    }
+
+    if(CONFIG.filters & PRIORITY_F) {
+        sort_todos_by_priority(todos);
+    }
+
+    for(int i = 0; todos[i].priority; i++) {
+        if(todo_matches_filters(&todos[i])) {
+            todo_is_found = true;
+
+            print_todo(&todos[i]);
+        }
+    }
+
+    if(!todo_is_found) {
+        printf("No TODOs.\n");
+    }
+}
+
+static void write_todo_record(FILE* file, todo_t* todo) {
+    const char* description = todo_description(todo);
+
+    if(description) {
+        fprintf(file, "%s:%ld \"%s\" {{\n  %s\n}}", "TODO", todo->priority, todo->title, description);
+    } else {
+        fprintf(file, "%s:%ld \"%s\" {{}}", "TODO", todo->priority, todo->title);
+    }
+}
+
+static void write_todo(FILE* file, todo_t* todo) {
+    write_todo_record(file, todo);
+    putc('\n', file);
+}
+
+/* Length of the longest prefix of str made of complete records. Quotes are
+ * tracked so that braces inside titles do not end a record early. */
+static size_t complete_records_len(const char* str, size_t len) {
+    bool in_title = false, in_description = false;
+    size_t records_len = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        if(in_description) {
+            if(str[i] == '}' && i + 1 < len && str[i + 1] == '}') {
+                in_description = false;
+                records_len = ++i + 1;
+            }
+        } else if(in_title) {
+            if(str[i] == '"') in_title = false;
+        } else if(str[i] == '"') {
+            in_title = true;
+        } else if(str[i] == '{' && i + 1 < len && str[i + 1] == '{') {
+            in_description = true;
+            ++i;
+        }
+    }
+
+    return records_len;
+}
+
+static int count_lines(const char* str, size_t len) {
+    int lines_count = 0;
+
+    for(const char* nl = str; (nl = memchr(nl, '\n', str + len - nl)); ++nl) {
+        lines_count++;
+    }
+
+    return lines_count;
+}
+
+/* Moves the first records_len bytes of buffer into a new string for
+ * parse_todos(). Returns NULL when they hold only whitespace. line_number is
+ * advanced past the skipped leading whitespace to the first line of records. */
+static char* take_records(char* buffer, size_t* buffer_len, size_t records_len, int* line_number) {
+    size_t begin = 0;
+    while(begin < records_len && isspace(buffer[begin])) begin++;
+
+    *line_number += count_lines(buffer, begin);
+
+    char* records = NULL;
+
+    if(begin < records_len) {
+        records = malloc(records_len - begin + 1);
+        if(!records) {
+            printf("Error: allocating memory.\n");
+            exit(1);
+        }
+
+        memcpy(records, buffer + begin, records_len - begin);
+        records[records_len - begin] = 0;
+    }
+
+    *buffer_len -= records_len;
+    memmove(buffer, buffer + records_len, *buffer_len);
+
+    return records;
+}
+
+typedef struct {
+    FILE* file;
+    char* buffer;
+    size_t buffer_len;
+    size_t buffer_size;
+    size_t chunk_size;
+    char* chunk;
+    todo_t* todos;
+    int todo_index;
+    int line_number;
+    FILE* error_stream;
+} todo_reader_t;
+
+static void init_todo_reader(todo_reader_t* reader, FILE* file, size_t chunk_size) {
+    memset(reader, 0, sizeof(todo_reader_t));
+
+    reader->file = file;
+    reader->line_number = 1;
+    reader->error_stream = stdout;
+    reader->chunk_size = chunk_size < MIN_READ_CHUNK_SIZE ? MIN_READ_CHUNK_SIZE : chunk_size;
+}
+
+static void close_todo_reader(todo_reader_t* reader) {
+    clear_todos(reader->todos);
+    free(reader->chunk);
+    free(reader->buffer);
+
+    memset(reader, 0, sizeof(todo_reader_t));
+}
+
+/* Parses the next run of complete records of roughly chunk_size bytes. The
+ * todos stay owned by the reader and are freed by the next call. */
+static todo_t* read_todo_chunk(todo_reader_t* reader) {
+    clear_todos(reader->todos);
+    free(reader->chunk);
+
+    reader->todos = NULL;
+    reader->chunk = NULL;
+    reader->todo_index = 0;
+
+    size_t records_len = 0;
+
+    while(true) {
+        records_len = complete_records_len(reader->buffer, reader->buffer_len);
+
+        if(records_len && reader->buffer_len >= reader->chunk_size) break;
+        if(feof(reader->file) || ferror(reader->file)) break;
+
+        size_t read_len = reader->buffer_len < reader->chunk_size 
+            ? reader->chunk_size - reader->buffer_len 
+            : reader->chunk_size;
+
+        if(reader->buffer_len + read_len + 1 > reader->buffer_size) {
+            reader->buffer_size = reader->buffer_len + read_len + 1;
+            reader->buffer = realloc(reader->buffer, reader->buffer_size);
+
+            if(!reader->buffer) {
+                printf("Error: allocating memory.\n");
+                exit(1);
+            }
+        }
+
+        reader->buffer_len += fread(reader->buffer + reader->buffer_len, 1, read_len, reader->file);
+    }
+
+    if(ferror(reader->file)) {
+        fflush(stdout);
+        fprintf(reader->error_stream, "Error: reading file.\n");
+        exit(1);
+    }
+
+    /* Leftovers at the end of file go to the parser so it reports them. */
+    if(feof(reader->file)) records_len = reader->buffer_len;
+
+    reader->chunk = take_records(reader->buffer, &reader->buffer_len, records_len, &reader->line_number);
+    if(!reader->chunk) return NULL;
+
+    char* error = NULL;
+    reader->todos = try_parse_todos(reader->chunk, true, reader->line_number, &error);
+
+    if(error) {
+        fflush(stdout);
+        fprintf(reader->error_stream, "%s", error);
+        exit(1);
+    }
+
+    reader->line_number += count_lines(reader->chunk, strlen(reader->chunk));
+
+    return reader->todos;
+}
+
+static todo_t* read_todo(todo_reader_t* reader) {
+    while(!reader->todos || !reader->todos[reader->todo_index].priority) {
+        if(!read_todo_chunk(reader)) return NULL;
+    }
+
+    return &reader->todos[reader->todo_index++];
+}
+
+static int compare_todos(const todo_t* a, const todo_t* b) {
+    if((CONFIG.filters & PRIORITY_F) && a->priority != b->priority) {
+        return a->priority < b->priority ? -1 : 1;
+    }
+
+    if(CONFIG.filters & TITLE_NAME_F) {
+        return tolower((unsigned char)a->title[0]) - tolower((unsigned char)b->title[0]);
+    }
+
+    return 0;
+}
+
+static int compare_todo_refs(const void* a, const void* b) {
+    const todo_t* todo_a = *(todo_t* const*)a;
+    const todo_t* todo_b = *(todo_t* const*)b;
+
+    int result = compare_todos(todo_a, todo_b);
+
+    /* Refs point into one array, so their order is the order in the file. */
+    return result ? result : (todo_a > todo_b) - (todo_a < todo_b);
+}
+
+static FILE* write_sorted_run(todo_t* todos) {
+    int todos_count = 0;
+    while(todos[todos_count].priority) todos_count++;
+
+    todo_t** refs = malloc(sizeof(todo_t*) * (todos_count + 1));
+    int refs_count = 0;
+
+    for(int i = 0; i < todos_count; i++) {
+        if(todo_matches_filters(&todos[i])) refs[refs_count++] = &todos[i];
+    }
+
+    qsort(refs, refs_count, sizeof(todo_t*), compare_todo_refs);
+
+    FILE* run = tmpfile();
+    if(!run) {
+        printf("Error: creating temporary file.\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < refs_count; i++) {
+        write_todo(run, refs[i]);
+    }
+
+    rewind(run);
+    free(refs);
+
+    return run;
+}
+
+static bool run_head_is_less(todo_t** heads, int a, int b) {
+    int result = compare_todos(heads[a], heads[b]);
+
+    return result ? result < 0 : a < b;
+}
+
+static void sift_down_runs(int* heap, int heap_len, todo_t** heads, int i) {
+    while(true) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+
+        if(left < heap_len && run_head_is_less(heads, heap[left], heap[smallest])) smallest = left;
+        if(right < heap_len && run_head_is_less(heads, heap[right], heap[smallest])) smallest = right;
+
+        if(smallest == i) return;
+
+        int temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+
+        i = smallest;
+    }
+}
+
+/* Merges sorted runs into one sorted run written to output, or printed when
+ * output is NULL. The runs are closed. */
+static bool merge_runs(FILE** runs, int runs_count, size_t chunk_size, FILE* output) {
+    todo_reader_t* run_readers = malloc(sizeof(todo_reader_t) * (runs_count + 1));
+    todo_t** heads = malloc(sizeof(todo_t*) * (runs_count + 1));
+    int* heap = malloc(sizeof(int) * (runs_count + 1));
+    int heap_len = 0;
+
+    for(int i = 0; i < runs_count; i++) {
+        init_todo_reader(&run_readers[i], runs[i], chunk_size);
+
+        heads[i] = read_todo(&run_readers[i]);
+        if(heads[i]) heap[heap_len++] = i;
+    }
+
+    for(int i = heap_len / 2 - 1; i >= 0; i--) {
+        sift_down_runs(heap, heap_len, heads, i);
+    }
+
+    bool todo_is_found = heap_len > 0;
+
+    while(heap_len) {
+        int run = heap[0];
+
+        if(output) write_todo(output, heads[run]);
+        else print_todo(heads[run]);
+
+        heads[run] = read_todo(&run_readers[run]);
+        if(!heads[run]) heap[0] = heap[--heap_len];
+
+        sift_down_runs(heap, heap_len, heads, 0);
+    }
+
+    for(int i = 0; i < runs_count; i++) {
+        close_todo_reader(&run_readers[i]);
+        fclose(runs[i]);
+    }
+
+    free(heap);
+    free(heads);
+    free(run_readers);
+
+    return todo_is_found;
+}
+
+/* Replaces the last runs_count runs of the stack with their merge. */
+static void merge_last_runs(FILE** runs, int* levels, int* stack_len, int runs_count, size_t chunk_size) {
+    int first = *stack_len - runs_count;
+
+    FILE* merged = tmpfile();
+    if(!merged) {
+        printf("Error: creating temporary file.\n");
+        exit(1);
+    }
+
+    merge_runs(runs + first, runs_count, chunk_size, merged);
+    rewind(merged);
+
+    runs[first] = merged;
+    levels[first]++;
+    *stack_len = first + 1;
+}
+
+/* External merge sort: the store is split into sorted runs of at most
+ * CONFIG.sort_memory_budget bytes that are spilled to temporary files and
+ * then k-way merged straight to the output. At most MAX_MERGE_RUNS runs, and
+ * no more than fit in the budget with a MIN_READ_CHUNK_SIZE buffer each, are
+ * merged at once; as soon as that many runs of the same level pile up they
+ * are merged into one run of the next level, which bounds the open files. */
+static void print_todos_external(store_t* store) {
+    size_t max_fan_in = CONFIG.sort_memory_budget / MIN_READ_CHUNK_SIZE;
+    int fan_in = max_fan_in < 2 ? 2 : max_fan_in > MAX_MERGE_RUNS ? MAX_MERGE_RUNS : (int)max_fan_in;
+    size_t chunk_size = CONFIG.sort_memory_budget / fan_in;
+
+    FILE** runs = NULL;
+    int* levels = NULL;
+    int runs_count = 0, runs_size = 0;
+
+    for(int i = 0; i < store->files_count; i++) {
+        FILE* file = fopen(store->file_names[i], "rb");
+        if(!file) {
+            printf("Error: '%s' file or directory does not exist.\n", store->file_names[i]);
+            exit(1);
+        }
+
+        todo_reader_t reader;
+        init_todo_reader(&reader, file, CONFIG.sort_memory_budget);
+
+        todo_t* todos = NULL;
+        while((todos = read_todo_chunk(&reader))) {
+            if(runs_count == runs_size) {
+                runs_size = runs_size ? runs_size * 2 : fan_in;
+                runs = realloc(runs, sizeof(FILE*) * runs_size);
+                levels = realloc(levels, sizeof(int) * runs_size);
+            }
+
+            runs[runs_count] = write_sorted_run(todos);
+            levels[runs_count++] = 0;
+
+            /* Levels never grow towards the top of the stack, so equal ends
+             * mean the last fan_in runs share a level. */
+            while(runs_count >= fan_in && levels[runs_count - fan_in] == levels[runs_count - 1]) {
+                merge_last_runs(runs, levels, &runs_count, fan_in, chunk_size);
+            }
+        }
+
+        close_todo_reader(&reader);
+        fclose(file);
+    }
+
+    while(runs_count > fan_in) {
+        merge_last_runs(runs, levels, &runs_count, fan_in, chunk_size);
+    }
+
+    printf("TODOs:\n");
+
+    if(!merge_runs(runs, runs_count, runs_count ? CONFIG.sort_memory_budget / runs_count : 0, NULL)) {
+        printf("No TODOs.\n");
+    }
+
+    free(levels);
+    free(runs);
+}
+
+/* Lock-free ring buffer for exactly one producer and one consumer thread. A
+ * side that finds it full or empty spins for a while and then sleeps on its
+ * own condition variable until the other side moves. */
+typedef struct {
+    void* items[PIPELINE_RING_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_bool producer_waiting;
+    atomic_bool consumer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t space_available;
+    pthread_cond_t data_available;
+} ring_t;
+
+static void init_ring(ring_t* ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->producer_waiting, false);
+    atomic_init(&ring->consumer_waiting, false);
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->space_available, NULL);
+    pthread_cond_init(&ring->data_available, NULL);
+}
+
+static void destroy_ring(ring_t* ring) {
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->space_available);
+    pthread_cond_destroy(&ring->data_available);
+}
+
+static bool ring_is_full(ring_t* ring) {
+    return atomic_load(&ring->tail) - atomic_load(&ring->head) == PIPELINE_RING_SIZE;
+}
+
+static bool ring_is_empty(ring_t* ring) {
+    return atomic_load(&ring->tail) == atomic_load(&ring->head);
+}
+
+static void wait_ring(ring_t* ring, bool (*is_blocked)(ring_t*), atomic_bool* is_waiting, pthread_cond_t* cond) {
+    for(int i = 0; i < PIPELINE_SPIN_COUNT; i++) {
+        if(!is_blocked(ring)) return;
+
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&ring->lock);
+
+    /* Set before the last check, so the other side either sees the flag or
+     * its move is seen by the check. */
+    atomic_store(is_waiting, true);
+
+    while(is_blocked(ring)) {
+        pthread_cond_wait(cond, &ring->lock);
+    }
+
+    atomic_store(is_waiting, false);
+
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void notify_ring(ring_t* ring, atomic_bool* is_waiting, pthread_cond_t* cond) {
+    if(!atomic_load(is_waiting)) return;
+
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void push_ring(ring_t* ring, void* item) {
+    wait_ring(ring, ring_is_full, &ring->producer_waiting, &ring->space_available);
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    ring->items[tail & (PIPELINE_RING_SIZE - 1)] = item;
+    atomic_store(&ring->tail, tail + 1);
+
+    notify_ring(ring, &ring->consumer_waiting, &ring->data_available);
+}
+
+static void* pop_ring(ring_t* ring) {
+    wait_ring(ring, ring_is_empty, &ring->consumer_waiting, &ring->data_available);
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    void* item = ring->items[head & (PIPELINE_RING_SIZE - 1)];
+    atomic_store(&ring->head, head + 1);
+
+    notify_ring(ring, &ring->producer_waiting, &ring->space_available);
+
+    return item;
+}
+
+/* Errors of the reader and parser threads are passed down the rings as the
+ * last chunk or batch and printed by the main thread. */
+typedef struct {
+    char* data;
+    size_t len;
+    bool is_file_end;
+    char* error;
+} pipeline_chunk_t;
+
+typedef struct {
+    char* content;
+    todo_t* todos;
+    char* error;
+} pipeline_batch_t;
+
+typedef struct {
+    store_t* store;
+    ring_t chunks;
+    ring_t batches;
+} pipeline_t;
+
+static void push_pipeline_chunk_error(pipeline_t* pipeline, const char* error) {
+    pipeline_chunk_t* chunk = calloc(1, sizeof(pipeline_chunk_t));
+
+    chunk->error = strdup(error);
+
+    push_ring(&pipeline->chunks, chunk);
+}
+
+static void* read_pipeline_chunks(void* arg) {
+    pipeline_t* pipeline = arg;
+
+    for(int i = 0; i < pipeline->store->files_count; i++) {
+        FILE* file = fopen(pipeline->store->file_names[i], "rb");
+        if(!file) {
+            push_pipeline_chunk_error(pipeline, "Error: opening file.\n");
+            return NULL;
+        }
+
+        bool is_file_end = false;
+
+        while(!is_file_end) {
+            pipeline_chunk_t* chunk = calloc(1, sizeof(pipeline_chunk_t));
+            chunk->data = malloc(PIPELINE_CHUNK_SIZE);
+
+            if(!chunk->data) {
+                printf("Error: allocating memory.\n");
+                exit(1);
+            }
+
+            chunk->len = fread(chunk->data, 1, PIPELINE_CHUNK_SIZE, file);
+
+            if(ferror(file)) {
+                free(chunk->data);
+                free(chunk);
+                fclose(file);
+
+                push_pipeline_chunk_error(pipeline, "Error: reading file.\n");
+                return NULL;
+            }
+
+            is_file_end = chunk->is_file_end = chunk->len < PIPELINE_CHUNK_SIZE;
+
+            push_ring(&pipeline->chunks, chunk);
+        }
+
+        fclose(file);
+    }
+
+    push_ring(&pipeline->chunks, NULL);
+
+    return NULL;
+}
+
+static void* parse_pipeline_chunks(void* arg) {
+    pipeline_t* pipeline = arg;
+
+    char* buffer = NULL;
+    size_t buffer_len = 0, buffer_size = 0;
+    int line_number = 1;
+
+    pipeline_chunk_t* chunk = NULL;
+
+    while((chunk = pop_ring(&pipeline->chunks))) {
+        if(chunk->error) {
+            pipeline_batch_t* batch = calloc(1, sizeof(pipeline_batch_t));
+            batch->error = chunk->error;
+
+            push_ring(&pipeline->batches, batch);
+
+            free(chunk);
+            free(buffer);
+            return NULL;
+        }
+
+        if(buffer_len + chunk->len + 1 > buffer_size) {
+            buffer_size = 2 * (buffer_len + chunk->len + 1);
+            buffer = realloc(buffer, buffer_size);
+
+            if(!buffer) {
+                printf("Error: allocating memory.\n");
+                exit(1);
+            }
+        }
+
+        memcpy(buffer + buffer_len, chunk->data, chunk->len);
+        buffer_len += chunk->len;
+
+        /* Leftovers at the end of file go to the parser so it reports them. */
+        size_t records_len = chunk->is_file_end ? buffer_len : complete_records_len(buffer, buffer_len);
+        char* content = take_records(buffer, &buffer_len, records_len, &line_number);
+
+        if(content) {
+            pipeline_batch_t* batch = calloc(1, sizeof(pipeline_batch_t));
+
+            batch->content = content;
+            batch->todos = try_parse_todos(content, true, line_number, &batch->error);
+
+            /* The main thread owns the batch once it is pushed. */
+            bool is_failed = batch->error != NULL;
+            line_number += count_lines(content, strlen(content));
+
+            push_ring(&pipeline->batches, batch);
+
+            if(is_failed) {
+                free(chunk->data);
+                free(chunk);
+                free(buffer);
+                return NULL;
+            }
+        }
+
+        if(chunk->is_file_end) line_number = 1;
+
+        free(chunk->data);
+        free(chunk);
+    }
+
+    free(buffer);
+
+    push_ring(&pipeline->batches, NULL);
+
+    return NULL;
+}
+
+/* Reading and parsing run in their own threads, connected to the printing
+ * thread by ring buffers, so the first todos are printed before the whole
+ * store is read. Todos are printed in file order, so it is only used for
+ * unsorted listings. */
+static void print_todos_pipelined(store_t* store) {
+    for(int i = 0; i < store->files_count; i++) {
+        if(get_file_size(store->file_names[i]) == -1) {
+            printf("Error: '%s' file or directory does not exist.\n", store->file_names[i]);
+            exit(1);
+        }
+    }
+
+    pipeline_t* pipeline = calloc(1, sizeof(pipeline_t));
+    pipeline->store = store;
+
+    init_ring(&pipeline->chunks);
+    init_ring(&pipeline->batches);
+
+    pthread_t reader_thread, parser_thread;
+
+    if(pthread_create(&reader_thread, NULL, read_pipeline_chunks, pipeline) ||
+       pthread_create(&parser_thread, NULL, parse_pipeline_chunks, pipeline)) {
+        printf("Error: creating pipeline threads.\n");
+        exit(1);
+    }
+
+    bool todo_is_found = false, is_header_printed = false;
+
+    pipeline_batch_t* batch = NULL;
+
+    while((batch = pop_ring(&pipeline->batches))) {
+        if(batch->error) {
+            fflush(stdout);
+            printf("%s", batch->error);
+            exit(1);
+        }
+
+        if(!is_header_printed) {
+            printf("TODOs:\n");
+            is_header_printed = true;
+        }
+
+        for(int i = 0; batch->todos[i].priority; i++) {
+            if(todo_matches_filters(&batch->todos[i])) {
+                todo_is_found = true;
+
+                print_todo(&batch->todos[i]);
+            }
+        }
+
+        fflush(stdout);
+
+        clear_todos(batch->todos);
+        free(batch->content);
+        free(batch);
+    }
+
+    pthread_join(reader_thread, NULL);
+    pthread_join(parser_thread, NULL);
+
+    if(!is_header_printed) {
+        printf("TODOs:\n");
+    }
+
+    if(!todo_is_found) {
+        printf("No TODOs.\n");
+    }
+
+    destroy_ring(&pipeline->chunks);
+    destroy_ring(&pipeline->batches);
+
+    free(pipeline);
+}
+
+static void show_version() {
+    printf("%s version(%s)\n", NAME, VERSION);
+}
+
+static void show_help() {
+    printf("%s version(%s)\n", NAME, VERSION);
+
+    printf("Flags:\n");
+    for(size_t i = 0; i < sizeof(FLAGS) / sizeof(FLAGS[0]); i++) {
+        printf("%4s or %-12s - %-64s\n", 
+                FLAGS[i].flag_short_str, 
+                FLAGS[i].flag_long_str, 
+                FLAGS[i].description); 
+    }
+}
+
+static bool does_file_exist(const char* file_name) {
+    FILE* file = fopen(file_name, "r");
+
+    return file ? true : false;
+}
+
+static void add_todo(todo_t* todo) {
+    if(!todo) return;
+
+    const char* file_name = get_todo_file_name(todo->title);
+
+    if(does_file_exist(file_name)) {
+        todo_t* todos = get_todos(file_name, NULL);    
+
+        bool is_found = false;
+
+        for(int i = 0; todos[i].priority; i++) {
+            if(!strcmp(todo->title, todos[i].title)) {
+                is_found = true;
+                break;
+            }    
+        }
+
+        if(is_found) {
+            printf("Error: todo with title '%s' is already in todos.\n", todo->title);
+
+            clear_todos(todos);
+            exit(1);
+        }
+
+        clear_todos(todos);
+    }
+
+    FILE* todo_file = fopen(file_name, "a+");  
+
+    write_todo(todo_file, todo);
+
+    fclose(todo_file);
+}
+
+static void remove_substring(char* str, const char* sub) {
+    char* pos = strstr(str, sub); 
+
+    if (pos != NULL) {
+        size_t len = strlen(sub);
+        memmove(pos, pos + len, strlen(pos + len) + 1); 
+    }
+}
+
+int find_substring_backwards(const char* start_pos, const char* str, const char* sub) {
+    size_t sub_len = strlen(sub);
+
+    if (start_pos < str || sub_len > (size_t)(start_pos - str + 1)) return -1;
+
+    for (const char *pos = start_pos; pos >= str; pos--) {
+        if (!strncmp(pos, sub, sub_len)) {
+            return pos - str;  
+        }
+    }
+
+    return -1;
+}
+
+static int find_strict_substring(const char *str, const char *substr) {
+    int substr_len = strlen(substr);
+    int str_len = strlen(str);
+    
+    for (int i = 0; i <= str_len - substr_len; i++) {
+        if (strncmp(&str[i], substr, substr_len) == 0) {
+            if (i + substr_len == str_len || !isalnum((unsigned char)str[i + substr_len])) {
+                return i;
+            }
+        }
+    }
+
+    return -1; 
+}
+
+static void remove_todo(const char* title_name) {
+    if(!title_name) return;
+
+    const char* file_name = get_todo_file_name(title_name);
+    char* file_content = NULL;
+
+    todo_t* todos = get_todos(file_name, &file_content);    
+    if(!todos) {
+        exit(1);
+    }
+
+    bool is_found = false;
+    for(int i = 0; todos[i].priority; i++) {
+        if(!strcmp(title_name, todos[i].title)) {
+            is_found = true;
+            break;
+        }    
+    }
+
+    if(!is_found) {
+        printf("Error: todo with title '%s' is not found.\n", title_name);
+
+        clear_todos(todos);
+        free(file_content);
+        exit(1);
+    }
+
+    int start = find_substring_backwards(file_content + find_strict_substring(file_content, title_name), file_content, "TODO"), 
+        len = 0;
+
+    while(!starts_with(file_content+start+len, "}}") && *(file_content+start+len)) len++;
+    len+=2;
+
+    if(*(file_content+start+len) == '\n') ++len;
+
+    char* remove_str = malloc(sizeof(char) * (len+1));
+    strncpy(remove_str, file_content+start, len);
+    remove_str[len] = 0;
+
+    remove_substring(file_content, remove_str);
+
+    FILE* todo_file = fopen(file_name, "w");
+    fprintf(todo_file, "%s", file_content);
+    fclose(todo_file);
+
+    free(remove_str);
+    free(file_content);
+    clear_todos(todos);
+}
+
+/* Rewrites only the 'TODO:<priority> "<title>"' header of the todo. A header
+ * that fits into the old one is padded with spaces and patched in place,
+ * otherwise the file is rewritten once around the new header. */
+static void edit_todo(const char* title_name, long priority, const char* new_title_name) {
+    if(!title_name) return;
+
+    const char* file_name = get_todo_file_name(title_name);
+    char* file_content = NULL;
+
+    todo_t* todos = get_todos(file_name, &file_content);
+    if(!todos) {
+        exit(1);
+    }
+
+    todo_t* todo = NULL;
+    for(int i = 0; todos[i].priority; i++) {
+        if(!strcmp(title_name, todos[i].title)) {
+            todo = &todos[i];
+        } else if(new_title_name && !strcmp(new_title_name, todos[i].title)) {
+            printf("Error: todo with title '%s' is already in todos.\n", new_title_name);
+
+            clear_todos(todos);
+            free(file_content);
+            exit(1);
+        }
+    }
+
+    if(!todo) {
+        printf("Error: todo with title '%s' is not found.\n", title_name);
+
+        clear_todos(todos);
+        free(file_content);
+        exit(1);
+    }
+
+    /* A new title of a sharded todo may belong to another shard. */
+    if(new_title_name && get_todo_file_name(new_title_name) != file_name) {
+        todo_t moved_todo = {
+            .title = (char*)new_title_name,
+            .description = (char*)todo_description(todo),
+            .priority = priority ? priority : todo->priority
+        };
+
+        add_todo(&moved_todo);
+        remove_todo(title_name);
+
+        free(file_content);
+        clear_todos(todos);
+        return;
+    }
+
+    int header_len = snprintf(NULL, 0, "%s:%ld \"%s\" ", "TODO", 
+            priority ? priority : todo->priority, new_title_name ? new_title_name : todo->title);
+
+    char* header = malloc(sizeof(char) * ((size_t)header_len > todo->header_len ? (size_t)header_len + 1 : todo->header_len + 1));
+
+    snprintf(header, header_len + 1, "%s:%ld \"%s\" ", "TODO", 
+            priority ? priority : todo->priority, new_title_name ? new_title_name : todo->title);
+
+    if((size_t)header_len <= todo->header_len) {
+        memset(header + header_len, ' ', todo->header_len - header_len);
+
+        int fd = open(file_name, O_WRONLY);
+
+        if(fd == -1 || pwrite(fd, header, todo->header_len, todo->offset) != (ssize_t)todo->header_len) {
+            printf("Error: writing '%s' file.\n", file_name);
+
+            if(fd != -1) close(fd);
+            exit(1);
+        }
+
+        close(fd);
+    } else {
+        FILE* todo_file = fopen(file_name, "w");
+
+        if(!todo_file) {
+            printf("Error: writing '%s' file.\n", file_name);
+            exit(1);
+        }
+
+        fwrite(file_content, 1, todo->offset, todo_file);
+        fwrite(header, 1, header_len, todo_file);
+        fputs(file_content + todo->offset + todo->header_len, todo_file);
+
+        fclose(todo_file);
+    }
+
+    free(header);
+    free(file_content);
+    clear_todos(todos);
+}
+
+typedef enum {
+    BASE_SIDE,
+    OURS_SIDE,
+    THEIRS_SIDE,
+} merge_side_t;
+
+typedef struct {
+    const char* title;
+    todo_t* todos[3];
+} merge_entry_t;
+
+typedef struct {
+    merge_entry_t* entries;
+    size_t size;
+} merge_table_t;
+
+static merge_entry_t* find_merge_entry(merge_table_t* table, const char* title) {
+    size_t i = hash_string(title) & (table->size - 1);
+
+    while(table->entries[i].title && strcmp(table->entries[i].title, title)) {
+        i = (i + 1) & (table->size - 1);
+    }
+
+    table->entries[i].title = title;
+
+    return &table->entries[i];
+}
+
+static todo_t* read_merge_todos(const char* file_name, char** file_content, int* todos_count) {
+    *file_content = read_file(file_name);
+    if(!*file_content) exit(1);
+
+    todo_t* todos = parse_todos(*file_content, true, 1);
+
+    for(*todos_count = 0; todos[*todos_count].priority; ++*todos_count);
+
+    return todos;
+}
+
+static void add_merge_todos(merge_table_t* table, todo_t* todos, merge_side_t side, const char* file_name) {
+    for(int i = 0; todos[i].priority; i++) {
+        merge_entry_t* entry = find_merge_entry(table, todos[i].title);
+
+        if(entry->todos[side]) {
+            printf("Error: todo with title '%s' is duplicated in '%s'.\n", todos[i].title, file_name);
+            exit(1);
+        }
+
+        entry->todos[side] = &todos[i];
+    }
+}
+
+static bool descriptions_are_equal(todo_t* a, todo_t* b) {
+    const char* description_a = todo_description(a);
+    const char* description_b = todo_description(b);
+
+    return !strcmp(description_a ? description_a : "", description_b ? description_b : "");
+}
+
+/* Merges priority and description separately, so that changes of different
+ * fields on both sides are not reported as a conflict. */
+static bool merge_todo(merge_entry_t* entry, todo_t* merged) {
+    todo_t *base = entry->todos[BASE_SIDE], *ours = entry->todos[OURS_SIDE], *theirs = entry->todos[THEIRS_SIDE];
+
+    for(int i = 0; i < 3; i++) {
+        if(entry->todos[i]) todo_description(entry->todos[i]);
+    }
+
+    if(!ours || !theirs) {
+        todo_t* kept = ours ? ours : theirs;
+
+        if(!base) {
+            *merged = *kept;
+            return true;
+        }
+
+        if(kept->priority == base->priority && descriptions_are_equal(kept, base)) {
+            merged->priority = 0;
+            return true;
+        }
+
+        printf("Conflict: todo '%s' is changed in %s and removed in %s.\n", 
+                entry->title, ours ? "ours" : "theirs", ours ? "theirs" : "ours");
+
+        *merged = *kept;
+        return false;
+    }
+
+    bool is_merged = true;
+
+    *merged = *ours;
+
+    if(ours->priority != theirs->priority) {
+        if(base && ours->priority == base->priority) merged->priority = theirs->priority;
+        else if(!base || theirs->priority != base->priority) is_merged = false;
+    }
+
+    if(!descriptions_are_equal(ours, theirs)) {
+        if(base && descriptions_are_equal(ours, base)) merged->description = (char*)todo_description(theirs);
+        else if(!base || !descriptions_are_equal(theirs, base)) is_merged = false;
+    }
+
+    if(!is_merged) {
+        printf("Conflict: todo '%s' is changed in both ours and theirs.\n", entry->title);
+    }
+
+    return is_merged;
+}
+
+/* Both sides of a conflicting todo are kept between git style markers, so the
+ * file has to be edited before it parses again. */
+static void write_merge_conflict(FILE* file, merge_entry_t* entry, const char* ours_content, const char* theirs_content) {
+    todo_t *ours = entry->todos[OURS_SIDE], *theirs = entry->todos[THEIRS_SIDE];
+
+    fputs("<<<<<<< ours\n", file);
+
+    if(ours) {
+        fwrite(ours_content + ours->offset, 1, ours->len, file);
+        putc('\n', file);
+    }
+
+    fputs("=======\n", file);
+
+    if(theirs) {
+        fwrite(theirs_content + theirs->offset, 1, theirs->len, file);
+        putc('\n', file);
+    }
+
+    fputs(">>>>>>> theirs", file);
+}
+
+/* Three-way merge usable as a git merge driver (todo -m %O %A %B). Records are
+ * matched by title through a hash table and the result is written to ours,
+ * keeping the order of ours followed by the records added in theirs. Only
+ * records that take a change from theirs are written in canonical form. */
+static void merge_todo_files(const char* base_file_name, const char* ours_file_name, const char* theirs_file_name) {
+    char *base_content = NULL, *ours_content = NULL, *theirs_content = NULL;
+    int base_count = 0, ours_count = 0, theirs_count = 0;
+
+    todo_t* base = read_merge_todos(base_file_name, &base_content, &base_count);
+    todo_t* ours = read_merge_todos(ours_file_name, &ours_content, &ours_count);
+    todo_t* theirs = read_merge_todos(theirs_file_name, &theirs_content, &theirs_count);
+
+    merge_table_t table = { .size = 16 };
+    while(table.size < 2 * (size_t)(base_count + ours_count + theirs_count)) table.size <<= 1;
+
+    table.entries = calloc(table.size, sizeof(merge_entry_t));
+    if(!table.entries) {
+        printf("Error: allocating memory.\n");
+        exit(1);
+    }
+
+    add_merge_todos(&table, base, BASE_SIDE, base_file_name);
+    add_merge_todos(&table, ours, OURS_SIDE, ours_file_name);
+    add_merge_todos(&table, theirs, THEIRS_SIDE, theirs_file_name);
+
+    FILE* todo_file = fopen(ours_file_name, "w");
+    if(!todo_file) {
+        printf("Error: writing '%s' file.\n", ours_file_name);
+        exit(1);
+    }
+
+    int conflicts_count = 0;
+    size_t ours_end = 0;
+
+    /* Records of ours that are not changed by the merge are copied byte for
+     * byte together with the text in front of them. */
+    for(int i = 0; i < ours_count; i++) {
+        merge_entry_t* entry = find_merge_entry(&table, ours[i].title);
+        todo_t merged = {0};
+
+        bool is_merged = merge_todo(entry, &merged);
+
+        if(is_merged && !merged.priority) {
+            ours_end = ours[i].offset + ours[i].len;
+            continue;
+        }
+
+        fwrite(ours_content + ours_end, 1, ours[i].offset - ours_end, todo_file);
+
+        if(!is_merged) {
+            write_merge_conflict(todo_file, entry, ours_content, theirs_content);
+            ++conflicts_count;
+        } else if(merged.priority == ours[i].priority && merged.description == ours[i].description) {
+            fwrite(ours_content + ours[i].offset, 1, ours[i].len, todo_file);
+        } else {
+            write_todo_record(todo_file, &merged);
+        }
+
+        ours_end = ours[i].offset + ours[i].len;
+    }
+
+    fputs(ours_content + ours_end, todo_file);
+
+    size_t ours_len = strlen(ours_content);
+    bool is_line_open = ours_len && ours_content[ours_len - 1] != '\n';
+
+    for(int i = 0; i < theirs_count; i++) {
+        merge_entry_t* entry = find_merge_entry(&table, theirs[i].title);
+        todo_t merged = {0};
+
+        if(entry->todos[OURS_SIDE]) continue;
+
+        bool is_merged = merge_todo(entry, &merged);
+
+        if(is_merged && !merged.priority) continue;
+
+        if(is_line_open) putc('\n', todo_file);
+
+        if(!is_merged) {
+            write_merge_conflict(todo_file, entry, ours_content, theirs_content);
+            ++conflicts_count;
+        } else {
+            fwrite(theirs_content + theirs[i].offset, 1, theirs[i].len, todo_file);
+        }
+
+        putc('\n', todo_file);
+        is_line_open = false;
+    }
+
+    fclose(todo_file);
+
+    free(table.entries);
+
+    clear_todos(base);
+    clear_todos(ours);
+    clear_todos(theirs);
+
+    free(base_content);
+    free(ours_content);
+    free(theirs_content);
+
+    if(conflicts_count) {
+        printf("Error: %d conflicting todos are marked in '%s'.\n", conflicts_count, ours_file_name);
+        exit(1);
+    }
+}
+
+static void shard_todos(int shards_count, const char* directory) {
+    if(shards_count <= 0 || shards_count > MAX_SHARDS_COUNT) {
+        printf("Error: shards count must be from 1 to %d.\n", MAX_SHARDS_COUNT);
+        exit(1);
+    }
+
+    store_t* store = get_store();
+
+    if(mkdir(directory, 0755) && errno != EEXIST) {
+        printf("Error: creating '%s' directory.\n", directory);
+        exit(1);
+    }
+
+    char* manifest_file_name = get_manifest_file_name(directory);
+
+    if(does_file_exist(manifest_file_name)) {
+        printf("Error: '%s' is already a todo store.\n", directory);
+        exit(1);
+    }
+
+    FILE** shards = malloc(sizeof(FILE*) * shards_count);
+
+    for(int i = 0; i < shards_count; i++) {
+        char* shard_file_name = get_shard_file_name(directory, i);
+
+        shards[i] = fopen(shard_file_name, "w");
+        if(!shards[i]) {
+            printf("Error: writing '%s' file.\n", shard_file_name);
+            exit(1);
+        }
+
+        free(shard_file_name);
+    }
+
+    for(int i = 0; i < store->files_count; i++) {
+        FILE* file = fopen(store->file_names[i], "rb");
+        if(!file) {
+            printf("Error: '%s' file or directory does not exist.\n", store->file_names[i]);
+            exit(1);
+        }
+
+        todo_reader_t reader;
+        init_todo_reader(&reader, file, 0);
+
+        todo_t* todo = NULL;
+        while((todo = read_todo(&reader))) {
+            write_todo(shards[hash_string(todo->title) % shards_count], todo);
+        }
+
+        close_todo_reader(&reader);
+        fclose(file);
+    }
+
+    for(int i = 0; i < shards_count; i++) {
+        fclose(shards[i]);
+    }
+
+    /* The manifest is written last, so a failed split is not a valid store. */
+    FILE* manifest = fopen(manifest_file_name, "w");
+    if(!manifest) {
+        printf("Error: writing '%s' file.\n", manifest_file_name);
+        exit(1);
+    }
+
+    fprintf(manifest, "shards: %d\n", shards_count);
+    fclose(manifest);
+
+    free(manifest_file_name);
+    free(shards);
+}
+
+typedef enum {
+    NDJSON_FORMAT,
+    CSV_FORMAT,
+} convert_format_t;
+
+static convert_format_t get_convert_format(const char* format) {
+    if(!strcmp(format, "ndjson")) return NDJSON_FORMAT;
+    if(!strcmp(format, "csv")) return CSV_FORMAT;
+
+    printf("Error: '%s' is undefined format, expected 'ndjson' or 'csv'.\n", format);
+    exit(1);
+}
+
+typedef struct {
+    char** titles;
+    size_t size;
+    size_t len;
+} title_set_t;
+
+static bool add_title(title_set_t* set, const char* title) {
+    if(2 * (set->len + 1) > set->size) {
+        title_set_t grown = { .size = set->size ? 2 * set->size : 1024 };
+        grown.titles = calloc(grown.size, sizeof(char*));
+
+        for(size_t i = 0; i < set->size; i++) {
+            if(!set->titles[i]) continue;
+
+            size_t j = hash_string(set->titles[i]) & (grown.size - 1);
+            while(grown.titles[j]) j = (j + 1) & (grown.size - 1);
+
+            grown.titles[j] = set->titles[i];
+        }
+
+        grown.len = set->len;
+
+        free(set->titles);
+        *set = grown;
+    }
+
+    size_t i = hash_string(title) & (set->size - 1);
+
+    while(set->titles[i]) {
+        if(!strcmp(set->titles[i], title)) return false;
+
+        i = (i + 1) & (set->size - 1);
+    }
+
+    set->titles[i] = strdup(title);
+    set->len++;
+
+    return true;
+}
+
+static void clear_title_set(title_set_t* set) {
+    for(size_t i = 0; i < set->size; i++) {
+        free(set->titles[i]);
+    }
+
+    free(set->titles);
+}
+
+static void import_error(size_t line_number, const char* message) {
+    fprintf(stderr, "Error: line %zu: %s.\n", line_number, message);
+}
+
+static bool validate_import_todo(todo_t* todo, title_set_t* titles, size_t line_number) {
+    if(todo->priority <= 0) {
+        import_error(line_number, "priority is invalid or less or equal to 0");
+    } else if(!todo->title || !*todo->title) {
+        import_error(line_number, "title is empty");
+    } else if(strchr(todo->title, '"')) {
+        import_error(line_number, "title contains '\"'");
+    } else if(todo->description && strstr(todo->description, "}}")) {
+        import_error(line_number, "description contains '}}'");
+    } else if(!add_title(titles, todo->title)) {
+        import_error(line_number, "title is duplicated");
+    } else {
+        return true;
+    }
+
+    return false;
+}
+
+static long parse_import_priority(const char* str) {
+    char* endptr = NULL;
+
+    errno = 0;
+    long priority = strtol(str, &endptr, 10);
+
+    while(isspace((unsigned char)*endptr)) ++endptr;
+
+    return errno || endptr == str || *endptr ? 0 : priority;
+}
+
+static void append_utf8(char** dst, unsigned long code_point) {
+    if(code_point < 0x80) {
+        *(*dst)++ = code_point;
+    } else if(code_point < 0x800) {
+        *(*dst)++ = 0xC0 | (code_point >> 6);
+        *(*dst)++ = 0x80 | (code_point & 0x3F);
+    } else if(code_point < 0x10000) {
+        *(*dst)++ = 0xE0 | (code_point >> 12);
+        *(*dst)++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *(*dst)++ = 0x80 | (code_point & 0x3F);
+    } else {
+        *(*dst)++ = 0xF0 | (code_point >> 18);
+        *(*dst)++ = 0x80 | ((code_point >> 12) & 0x3F);
+        *(*dst)++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *(*dst)++ = 0x80 | (code_point & 0x3F);
+    }
+}
+
+static bool parse_json_hex(const char** pos, unsigned long* code_point) {
+    char hex[5] = {0};
+
+    for(int i = 0; i < 4; i++) {
+        if(!isxdigit((unsigned char)(*pos)[i])) return false;
+        hex[i] = (*pos)[i];
+    }
+
+    *code_point = strtoul(hex, NULL, 16);
+    *pos += 4;
+
+    return true;
+}
+
+/* Unescapes a JSON string into a new string in one pass, the same way
+ * replace_escape_sequences() does for arguments. An escaped character is
+ * never shorter than its output, so the output fits into the input length. */
+static char* parse_json_string(const char** pos) {
+    if(**pos != '"') return NULL;
+
+    const char* src = ++*pos;
+    const char* end = src;
+
+    while(*end && *end != '"') end += *end == '\\' && end[1] ? 2 : 1;
+    if(*end != '"') return NULL;
+
+    char* str = malloc(end - src + 1);
+    char* dst = str;
+
+    while(src < end) {
+        if(*src != '\\') {
+            *dst++ = *src++;
+            continue;
+        }
+
+        unsigned long code_point = 0;
+
+        switch(*++src) {
+            case 'n': *dst++ = '\n'; src++; break;
+            case 't': *dst++ = '\t'; src++; break;
+            case 'r': *dst++ = '\r'; src++; break;
+            case 'b': *dst++ = '\b'; src++; break;
+            case 'f': *dst++ = '\f'; src++; break;
+            case '"': case '\\': case '/': *dst++ = *src++; break;
+
+            case 'u':
+                ++src;
+
+                if(!parse_json_hex(&src, &code_point)) {
+                    free(str);
+                    return NULL;
+                }
+
+                if(code_point >= 0xD800 && code_point < 0xDC00 && src[0] == '\\' && src[1] == 'u') {
+                    unsigned long low = 0;
+                    const char* low_pos = src + 2;
+
+                    if(parse_json_hex(&low_pos, &low) && low >= 0xDC00 && low < 0xE000) {
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                        src = low_pos;
+                    }
+                }
+
+                /* NUL would cut the string short and a lone surrogate is not valid UTF-8. */
+                if(code_point == 0 || (code_point >= 0xD800 && code_point < 0xE000)) {
+                    free(str);
+                    return NULL;
+                }
+
+                append_utf8(&dst, code_point);
+                break;
+
+            default:
+                free(str);
+                return NULL;
+        }
+    }
+
+    *dst = 0;
+    *pos = end + 1;
+
+    return str;
+}
+
+static void skip_json_space(const char** pos) {
+    while(isspace((unsigned char)**pos)) ++*pos;
+}
+
+static bool skip_json_value(const char** pos) {
+    int depth = 0;
+
+    do {
+        skip_json_space(pos);
+
+        if(**pos == '"') {
+            char* str = parse_json_string(pos);
+            if(!str) return false;
+
+            free(str);
+        } else if(**pos == '{' || **pos == '[') {
+            ++depth;
+            ++*pos;
+        } else if(**pos == '}' || **pos == ']') {
+            if(!depth--) return false;
+            ++*pos;
+        } else if(**pos == ',' || **pos == ':') {
+            if(!depth) return false;
+            ++*pos;
+        } else {
+            const char* begin = *pos;
+
+            while(**pos && !isspace((unsigned char)**pos) && !strchr(",:{}[]\"", **pos)) ++*pos;
+            if(*pos == begin) return false;
+        }
+    } while(depth);
+
+    return true;
+}
+
+static bool parse_ndjson_todo(const char* line, todo_t* todo) {
+    const char* pos = line;
+
+    skip_json_space(&pos);
+    if(*pos++ != '{') return false;
+
+    skip_json_space(&pos);
+    if(*pos == '}') return true;
+
+    while(true) {
+        skip_json_space(&pos);
+
+        char* key = parse_json_string(&pos);
+        if(!key) return false;
+
+        skip_json_space(&pos);
+        if(*pos++ != ':') {
+            free(key);
+            return false;
+        }
+
+        skip_json_space(&pos);
+
+        char** field = !strcmp(key, "title") ? &todo->title : !strcmp(key, "description") ? &todo->description : NULL;
+        bool is_priority = !strcmp(key, "priority");
+
+        free(key);
+
+        if(field && *pos == '"') {
+            free(*field);
+            *field = parse_json_string(&pos);
+
+            if(!*field) return false;
+        } else if(is_priority && *pos == '"') {
+            char* priority = parse_json_string(&pos);
+            if(!priority) return false;
+
+            todo->priority = parse_import_priority(priority);
+            free(priority);
+        } else if(is_priority) {
+            char* endptr = NULL;
+
+            errno = 0;
+            long priority = strtol(pos, &endptr, 10);
+            if(endptr == pos) return false;
+
+            /* Out of range is an invalid priority, as for the string form. */
+            todo->priority = errno ? 0 : priority;
+            pos = endptr;
+        } else if(!skip_json_value(&pos)) {
+            return false;
+        }
+
+        skip_json_space(&pos);
+
+        if(*pos == ',') {
+            ++pos;
+            continue;
+        }
+
+        if(*pos++ != '}') return false;
+
+        skip_json_space(&pos);
+        return !*pos;
+    }
+}
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t size;
+} string_buffer_t;
+
+static void append_char(string_buffer_t* buffer, char ch) {
+    if(buffer->len + 1 >= buffer->size) {
+        buffer->size = buffer->size ? 2 * buffer->size : 256;
+        buffer->data = realloc(buffer->data, buffer->size);
+
+        if(!buffer->data) {
+            printf("Error: allocating memory.\n");
+            exit(1);
+        }
+    }
+
+    buffer->data[buffer->len++] = ch;
+}
+
+/* Reads one RFC 4180 record. Fields are NUL separated in the record buffer
+ * and "" inside quoted fields is unescaped while reading. */
+static int read_csv_record(FILE* file, string_buffer_t* record, size_t* line_number) {
+    int fields_count = 0, ch = 0;
+    bool in_quotes = false, is_field_start = true;
+
+    record->len = 0;
+
+    while((ch = getc(file)) != EOF) {
+        if(ch == '\n') ++*line_number;
+
+        if(in_quotes) {
+            if(ch != '"') {
+                append_char(record, ch);
+                continue;
+            }
+
+            ch = getc(file);
+
+            if(ch == '"') {
+                append_char(record, '"');
+                continue;
+            }
+
+            in_quotes = false;
+
+            if(ch == EOF) break;
+            if(ch == '\n') ++*line_number;
+        }
+
+        if(ch == '"' && is_field_start) {
+            in_quotes = true;
+            is_field_start = false;
+        } else if(ch == ',') {
+            append_char(record, 0);
+            ++fields_count;
+            is_field_start = true;
+        } else if(ch == '\n') {
+            break;
+        } else if(ch != '\r') {
+            append_char(record, ch);
+            is_field_start = false;
+        }
+    }
+
+    if(ch == EOF && !record->len && !fields_count) return 0;
+
+    append_char(record, 0);
+
+    return fields_count + 1;
+}
+
+static const char* get_csv_field(string_buffer_t* record, int fields_count, int index) {
+    if(index < 0 || index >= fields_count) return NULL;
+
+    const char* field = record->data;
+    while(index--) field += strlen(field) + 1;
+
+    return field;
+}
+
+static bool import_todo(todo_t* todo, title_set_t* titles, size_t line_number) {
+    if(todo->description) {
+        char* description = strip(todo->description, strlen(todo->description));
+
+        free(todo->description);
+        todo->description = description;
+    }
+
+    bool is_valid = validate_import_todo(todo, titles, line_number);
+
+    if(is_valid) write_todo(stdout, todo);
+
+    free(todo->title);
+    free(todo->description);
+
+    return is_valid;
+}
+
+/* Converts stdin to todo syntax on stdout. Invalid records are reported and
+ * skipped, so that a whole export is validated in one run. */
+static void import_todos(convert_format_t format) {
+    setvbuf(stdout, NULL, _IOFBF, CONVERT_BUFFER_SIZE);
+
+    title_set_t titles = {0};
+    size_t line_number = 0, invalid_count = 0;
+
+    if(format == NDJSON_FORMAT) {
+        char* line = NULL;
+        size_t line_size = 0;
+
+        while(getline(&line, &line_size, stdin) != -1) {
+            ++line_number;
+
+            const char* pos = line;
+            skip_json_space(&pos);
+            if(!*pos) continue;
+
+            todo_t todo = {0};
+
+            if(!parse_ndjson_todo(line, &todo)) {
+                import_error(line_number, "invalid json object");
+
+                free(todo.title);
+                free(todo.description);
+
+                ++invalid_count;
+                continue;
+            }
+
+            if(!import_todo(&todo, &titles, line_number)) ++invalid_count;
+        }
+
+        free(line);
+    } else {
+        string_buffer_t record = {0};
+        int priority_index = -1, title_index = -1, description_index = -1;
+
+        size_t record_line_number = 0;
+        int fields_count = read_csv_record(stdin, &record, &line_number);
+
+        for(int i = 0; i < fields_count; i++) {
+            const char* field = get_csv_field(&record, fields_count, i);
+
+            if(!strcmp(field, "priority")) priority_index = i;
+            else if(!strcmp(field, "title")) title_index = i;
+            else if(!strcmp(field, "description")) description_index = i;
+        }
+
+        if(priority_index == -1 || title_index == -1) {
+            fprintf(stderr, "Error: csv header requires 'priority' and 'title' columns.\n");
+            exit(1);
+        }
+
+        while(true) {
+            record_line_number = line_number + 1;
+
+            fields_count = read_csv_record(stdin, &record, &line_number);
+            if(!fields_count) break;
+
+            if(fields_count == 1 && !*record.data) continue;
+
+            const char* priority = get_csv_field(&record, fields_count, priority_index);
+            const char* title = get_csv_field(&record, fields_count, title_index);
+            const char* description = get_csv_field(&record, fields_count, description_index);
+
+            todo_t todo = {
+                .priority = priority ? parse_import_priority(priority) : 0,
+                .title = title ? strdup(title) : NULL,
+                .description = description && *description ? strdup(description) : NULL
+            };
+
+            if(!import_todo(&todo, &titles, record_line_number)) ++invalid_count;
+        }
+
+        free(record.data);
+    }
+
+    fflush(stdout);
+    clear_title_set(&titles);
+
+    if(invalid_count) {
+        fprintf(stderr, "Error: %zu invalid records are skipped.\n", invalid_count);
+        exit(1);
+    }
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    putc('"', file);
+
+    const char* begin = str;
+
+    for(; *str; str++) {
+        unsigned char ch = *str;
+
+        if(ch >= 0x20 && ch != '"' && ch != '\\') continue;
+
+        fwrite(begin, 1, str - begin, file);
+        begin = str + 1;
+
+        switch(ch) {
+            case '"': fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\t': fputs("\\t", file); break;
+            case '\r': fputs("\\r", file); break;
+            default: fprintf(file, "\\u%04x", ch); break;
+        }
+    }
+
+    fwrite(begin, 1, str - begin, file);
+    putc('"', file);
+}
+
+static void write_csv_field(FILE* file, const char* str) {
+    if(!strpbrk(str, ",\"\r\n")) {
+        fputs(str, file);
+        return;
+    }
+
+    putc('"', file);
+
+    for(; *str; str++) {
+        if(*str == '"') putc('"', file);
+        putc(*str, file);
+    }
+
+    putc('"', file);
+}
+
+static void export_todos(convert_format_t format) {
+    setvbuf(stdout, NULL, _IOFBF, CONVERT_BUFFER_SIZE);
+
+    store_t* store = get_store();
+
+    if(format == CSV_FORMAT) fputs("priority,title,description\n", stdout);
+
+    for(int i = 0; i < store->files_count; i++) {
+        FILE* file = fopen(store->file_names[i], "rb");
+        if(!file) {
+            fflush(stdout);
+            fprintf(stderr, "Error: '%s' file or directory does not exist.\n", store->file_names[i]);
+            exit(1);
+        }
+
+        /* Errors go to stderr so they never end up inside the exported data. */
+        todo_reader_t reader;
+        init_todo_reader(&reader, file, CONVERT_BUFFER_SIZE);
+        reader.error_stream = stderr;
+
+        todo_t* todo = NULL;
+        while((todo = read_todo(&reader))) {
+            if(!todo_matches_filters(todo)) continue;
+
+            const char* description = todo_description(todo);
+
+            if(format == NDJSON_FORMAT) {
+                fprintf(stdout, "{\"priority\":%ld,\"title\":", todo->priority);
+                write_json_string(stdout, todo->title);
+                fputs(",\"description\":", stdout);
+
+                if(description) write_json_string(stdout, description);
+                else fputs("null", stdout);
+
+                fputs("}\n", stdout);
+            } else {
+                fprintf(stdout, "%ld,", todo->priority);
+                write_csv_field(stdout, todo->title);
+                putc(',', stdout);
+                write_csv_field(stdout, description ? description : "");
+                putc('\n', stdout);
+            }
+        }
+
+        close_todo_reader(&reader);
+        fclose(file);
+    }
+
+    fflush(stdout);
+}
+
+static int execute_flag(flag_action_t action, char* argv[]) {
+    char* flag = *argv;
+    int offset = 0; 
+
+    ++argv;
+
+    switch(action) {
+        case SHOW_HELP:
+            show_help();
+            exit(0);
+
+        case SHOW_VERSION:
             show_version();
             exit(0);
 
@@ -739,6 +3090,40 @@ static int execute_flag(flag_action_t action, char* argv[]) {
             CONFIG.priority_level = atoi(*argv);
             break;
 
+        case SET_WHERE_FILTER:
+            if(!*argv) {
+                printf("Error: flag '%s' requires expression.\n", flag);
+
+                exit(1);
+            }
+
+            ++offset;
+
+            compile_where(&WHERE, *argv);
+            break;
+
+        case SET_PIPELINE_MODE:
+            CONFIG.is_pipelined = true;
+            break;
+
+        case SET_SORT_MEMORY_BUDGET:
+            if(!*argv) {
+                printf("Error: flag '%s' requires number value.\n", flag);
+
+                exit(1);
+            }
+
+            if(!is_num(*argv)) {
+                printf("Error: '%s' is invalid memory budget.\n", *argv);
+
+                exit(1);
+            }
+
+            ++offset;
+
+            CONFIG.sort_memory_budget = strtoull(*argv, NULL, 10);
+            break;
+
 
         case ADD_TODO:
             if(!*argv) {
@@ -795,6 +3180,102 @@ static int execute_flag(flag_action_t action, char* argv[]) {
 
             exit(0);
 
+        case EDIT_TODO:
+            if(!*argv) {
+                printf("Error: flag '%s' requires todo title name.\nUsage: -e <title_name> [--priority <number>] [--title <new_title_name>]\n", flag);
+
+                exit(1);
+            }
+
+            char* title_name = *argv;
+            char* new_title_name = NULL;
+            long priority = 0;
+
+            replace_escape_sequences(title_name);
+
+            for(++argv; *argv; argv += 2) {
+                if(!argv[1]) {
+                    printf("Error: '%s' requires value.\n", *argv);
+
+                    exit(1);
+                }
+
+                if(!strcmp(*argv, FLAG_IDENTIFIER FLAG_IDENTIFIER "priority")) {
+                    if(!is_num(argv[1]) || atoi(argv[1]) <= 0) {
+                        printf("Error: '%s' is invalid priority.\n", argv[1]);
+
+                        exit(1);
+                    }
+
+                    priority = atoi(argv[1]);
+                } else if(!strcmp(*argv, FLAG_IDENTIFIER FLAG_IDENTIFIER "title")) {
+                    new_title_name = argv[1];
+
+                    replace_escape_sequences(new_title_name);
+
+                    if(!*new_title_name || strchr(new_title_name, '"')) {
+                        printf("Error: '%s' is invalid title name.\n", new_title_name);
+
+                        exit(1);
+                    }
+                } else {
+                    printf("Error: '%s' is undefined edit option.\n", *argv);
+
+                    exit(1);
+                }
+            }
+
+            if(!priority && !new_title_name) {
+                printf("Error: flag '%s' requires '--priority' or '--title'.\n", flag);
+
+                exit(1);
+            }
+
+            edit_todo(title_name, priority, new_title_name);
+
+            exit(0);
+
+        case MERGE_TODOS:
+            if(!argv[0] || !argv[1] || !argv[2]) {
+                printf("Error: flag '%s' requires 3 file names.\nUsage: -m <base> <ours> <theirs>\n", flag);
+
+                exit(1);
+            }
+
+            merge_todo_files(argv[0], argv[1], argv[2]);
+
+            exit(0);
+
+        case SHARD_TODOS:
+            if(!argv[0] || !argv[1]) {
+                printf("Error: flag '%s' requires shards count and directory.\nUsage: -s <count> <directory>\n", flag);
+
+                exit(1);
+            }
+
+            if(!is_num(argv[0])) {
+                printf("Error: '%s' is invalid shards count.\n", argv[0]);
+
+                exit(1);
+            }
+
+            shard_todos(atoi(argv[0]), argv[1]);
+
+            exit(0);
+
+        case IMPORT_TODOS:
+        case EXPORT_TODOS:
+            if(!*argv) {
+                printf("Error: flag '%s' requires format.\nUsage: %s <ndjson|csv>\n", flag, flag);
+
+                exit(1);
+            }
+
+            if(action == IMPORT_TODOS) import_todos(get_convert_format(*argv));
+            else export_todos(get_convert_format(*argv));
+
+            exit(0);
+
         default:
             printf("Error: '%d' is undefined flag action.\n", action);
             exit(1);
@@ -836,11 +3317,48 @@ int main(int argc, char* argv[]) {
         check_flags(argc-1, argv+1);
     }
 
-    todo_t* todos = get_todos();
+    /* Pipelined todos are printed in file order, so sorting cannot be kept. */
+    if(CONFIG.is_pipelined && (CONFIG.filters & (PRIORITY_F | TITLE_NAME_F))) {
+        printf("Error: flag '-P' prints unsorted todos and requires '-p=0' without '-t=1'.\n");
+        exit(1);
+    }
+
+    store_t* store = get_store();
+
+    if(CONFIG.sort_memory_budget && (CONFIG.filters & (PRIORITY_F | TITLE_NAME_F)) &&
+       (size_t)get_store_size(store) > CONFIG.sort_memory_budget) {
+        print_todos_external(store);
+
+        return 0;
+    }
+
+    if(CONFIG.is_pipelined) {
+        print_todos_pipelined(store);
+
+        return 0;
+    }
+
+    if(!store->is_sharded) {
+        char* file_content = NULL;
+
+        todo_t* todos = get_todos(CONFIG.todo_file_name, &file_content);
+
+        print_todos(todos);
+
+        clear_todos(todos);
+        free(file_content);
+
+        return 0;
+    }
+
+    char** file_contents = NULL;
+
+    todo_t* todos = get_store_todos(store, &file_contents);
 
     print_todos(todos);
 
     clear_todos(todos);
+    free_file_contents(file_contents);
 
     return 0;
 }